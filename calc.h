@@ -0,0 +1,113 @@
+/*
+	libcalc: Shell calc's expression evaluator as a library.
+	Build it with './compile.sh lib', which makes libcalc.a and libcalc.so.
+
+	An expression is compiled once and can then be evaluated as often as you like.
+	Any name in it that isn't a built-in constant (pi, e) is a variable, which is 0
+	until it's bound. Everything that doesn't depend on a variable is worked out
+	while compiling.
+
+		struct calcExpr *e = calcCompile("sin(x)^2 + 2*pi*r");
+
+		if(calcErrorCode(e) != 0)
+			printf("%s (column %u)\n", calcErrorMessage(e), calcErrorPos(e) + 1);
+
+		calcBind(e, "x", 0.5);
+		calcBind(e, "r", 3);
+
+		double result;
+		if(calcEval(e, &result) == 0)
+			printf("%f\n", result);
+
+		calcFree(e);
+
+	A handle must only be used by one thread at a time. Separate handles can be
+	used from separate threads. The library always does 64-bit integer and double
+	math; --bigint, --prec and matrices are only available from the command line.
+*/
+
+#ifndef CALC_H
+#define CALC_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// calcErrorPos() for errors that aren't about any particular part of the expression
+#define CALC_NO_POS			0xFFFFFFFFu
+
+struct calcExpr;
+
+// Compiles 'expr'. Returns 0 only if there's no memory for the handle. Otherwise the
+// handle has to be freed with calcFree(), even when the expression has an error.
+struct calcExpr *calcCompile(const char *expr);
+
+// 0 if compiling (and the last evaluation) worked. Otherwise, what went wrong and
+// where: the byte offset in the expression, or CALC_NO_POS.
+int calcErrorCode(const struct calcExpr *e);
+unsigned calcErrorPos(const struct calcExpr *e);
+const char *calcErrorMessage(struct calcExpr *e);
+
+// Variables are numbered in the order they first appear in the expression
+int calcVarCount(const struct calcExpr *e);
+const char *calcVarName(const struct calcExpr *e, int var);
+
+// Sets variable 'name' for calcEval(). Returns its number, or -1 if the expression
+// doesn't use it. Whole numbers are used as integers, like they would be if they
+// had been typed into the expression.
+int calcBind(struct calcExpr *e, const char *name, double value);
+
+// Evaluates the expression with the bound values. Returns 0 or an error code.
+int calcEval(struct calcExpr *e, double *result);
+
+// Nonzero switches sin(), cos() and ^ to quicker kernels that can be a few units in
+// the last place off (calc.c lists how many), and lets calcEvalBatch() run them over
+// many rows at once. Polynomials in one variable are worked out in one step, which
+// rounds differently too. It's off to begin with, which gives the C library's results.
+void calcFastMath(struct calcExpr *e, int on);
+
+// Evaluates the expression once per row of 'vars', which holds calcVarCount()
+// values per row in variable order. Rows that can't be evaluated get NaN, and the
+// error functions describe the first of them. Returns the number of those rows.
+size_t calcEvalBatch(struct calcExpr *e, const double *vars, size_t rows, double *results);
+
+// calcCompile() with complex numbers, as with calc --complex: i is the imaginary
+// unit, and square roots and fractional powers of negative numbers are complex.
+// calcEval() and calcEvalBatch() give just the real part of the result. Complex
+// expressions don't have gradients.
+struct calcExpr *calcCompileComplex(const char *expr);
+
+// calcBind() with an imaginary part. Returns -1 for expressions from calcCompile().
+int calcBindComplex(struct calcExpr *e, const char *name, double re, double im);
+int calcEvalComplex(struct calcExpr *e, double *re, double *im);
+
+// calcEvalBatch() for complex numbers, with the real and imaginary parts in arrays
+// of their own. 'im' can be 0 if the variables are all real, and is ignored for
+// expressions from calcCompile(). This works in doubles throughout, so integers
+// past 2^53 can come out differently than from calcEvalComplex().
+size_t calcEvalComplexBatch(struct calcExpr *e, const double *re, const double *im, size_t rows, double *outRe, double *outIm);
+
+// How calcEvalGrad() and calcEvalGradBatch() work out derivatives. Both give the
+// same ones, give or take rounding.
+#define CALC_FORWARD		0	// Dual numbers. Quickest with one or two variables.
+#define CALC_REVERSE		1	// Evaluates, then goes back over it once. The cost
+								// doesn't go up with the number of variables.
+
+// calcEval() that also gives the partial derivative of the result with respect to
+// each variable, calcVarCount() of them in variable order, in 'grad'. Functions
+// without a derivative in calc.c's list give NaN.
+int calcEvalGrad(struct calcExpr *e, int mode, double *result, double *grad);
+
+// calcEvalBatch() with gradients. 'grads' gets calcVarCount() values per row, which
+// are NaN for the rows that can't be evaluated.
+size_t calcEvalGradBatch(struct calcExpr *e, int mode, const double *vars, size_t rows, double *results, double *grads);
+
+void calcFree(struct calcExpr *e);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,581 @@
+/*
+	calc.hpp: Shell calc expressions for C++20, parsed at compile time.
+
+	For formulas that are fixed when your program is built. The expression is parsed
+	by the compiler into a type, so evaluating it is straight-line code with nothing
+	left to parse at run time. The grammar is the same as calc's own: numbers in
+	decimal, hex (0xFF), octal (0377) or with an exponent (2.55e2), the operators
+	+ - * / % ^ and postfix !, unary minus binding tighter than ^, parentheses, and
+	the constants and functions built into calc.c. Any other name is a variable.
+	Variables are passed in the order they first appear in the expression:
+
+		#include "calc.hpp"
+
+		constexpr calc::expr<"sin(x)^2 + 2*pi*r"> f;
+		double y = f(0.5, 3.0);		// x = 0.5, r = 3
+
+		static_assert(f.varCount == 2 && f.varName(1) == "r");
+
+	A malformed expression fails to compile. The error points at the line in here
+	that rejected it, and that line says what was wrong.
+
+	calc_tables.h has the constants and functions. It's copied out of calc.c by
+	compile.sh, so run './compile.sh' once before using this header.
+
+	Unlike calc, everything is worked out in double precision: whole numbers aren't
+	kept as 64-bit integers. Decimal numbers with more than 19 digits or an
+	exponent beyond 10^22 may also come out one unit off in the last place.
+*/
+
+#ifndef CALC_HPP
+#define CALC_HPP
+
+#include <math.h>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string_view>
+#include <tuple>
+
+#include "calc_tables.h"
+
+namespace calc
+{
+
+// ---- Constants and functions, from calc.c ----
+
+#define CALC_HPP_NAME(name, ...)			#name,
+#define CALC_HPP_VALUE(name, value, desc)	value,
+#define CALC_HPP_CALL(name, ...)			[](double a) { return ::name(a); },
+
+inline constexpr std::string_view constNames[] = {CALC_CONSTANTS(CALC_HPP_NAME)};
+inline constexpr double constValues[] = {CALC_CONSTANTS(CALC_HPP_VALUE)};
+inline constexpr std::string_view funcNames[] = {CALC_FUNCTIONS(CALC_HPP_NAME)};
+inline constexpr std::tuple funcs{CALC_FUNCTIONS(CALC_HPP_CALL)};
+
+#undef CALC_HPP_NAME
+#undef CALC_HPP_VALUE
+#undef CALC_HPP_CALL
+
+// ---- Parsing ----
+
+// A string literal that can be a template argument
+template<std::size_t N>
+struct fixedString
+{
+	char text[N];
+
+	constexpr fixedString(const char (&str)[N])
+	{
+		for(std::size_t i = 0; i < N; i++)
+			text[i] = str[i];
+	}
+
+	constexpr std::size_t size() const { return N - 1; }
+};
+
+// A node of the parsed expression. 'op' is an operator like in calc.c: 'n' is
+// unary minus and 'f' a function call. 'c' is a number and 'v' a variable.
+struct exprNode
+{
+	char op;
+	double value;		// 'c'
+	int index;			// The variable, or the function in funcs
+	int a;				// Operands
+	int b;
+};
+
+// Every node comes from at least one character, so N nodes are always enough
+template<std::size_t N>
+struct exprTree
+{
+	exprNode nodes[N];
+	int count;
+	int root;
+
+	int varPos[N];		// Where each variable's name is in the expression
+	int varLen[N];
+	int varCount;
+};
+
+namespace detail
+{
+
+constexpr bool isSpace(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+constexpr bool isDigit(char c) { return c >= '0' && c <= '9'; }
+constexpr bool isIdentStart(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
+constexpr bool isIdent(char c) { return isIdentStart(c) || isDigit(c); }
+constexpr bool isHex(char c) { return isDigit(c) || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f'); }
+
+constexpr int digitValue(char c)
+{
+	return (c <= '9') ? c - '0' : (c | 0x20) - 'a' + 10;
+}
+
+// Exact powers of ten as doubles
+constexpr double pow10(int n)
+{
+	double r = 1.0;
+	for(int i = 0; i < n; i++)
+		r *= 10.0;
+
+	return r;
+}
+
+template<std::size_t N>
+struct parser
+{
+	const char *s;
+	std::size_t len;
+	std::size_t pos;
+	exprTree<N> tree;
+
+	constexpr void skipSpace()
+	{
+		while(pos < len && isSpace(s[pos]))
+			pos++;
+	}
+
+	constexpr int add(char op, int a, int b, double value = 0.0, int index = 0)
+	{
+		tree.nodes[tree.count] = exprNode{op, value, index, a, b};
+		return tree.count++;
+	}
+
+	// calc ignores an operator with nothing after it, like the '+' in '2+'
+	constexpr bool trailingOperator()
+	{
+		std::size_t i = pos;
+		while(i < len && (isSpace(s[i]) || s[i] == '-'))
+			i++;
+
+		return i == len;
+	}
+
+	constexpr int parseSum()
+	{
+		int lhs = parseProduct();
+
+		for(skipSpace(); pos < len && (s[pos] == '+' || s[pos] == '-'); skipSpace())
+		{
+			char op = s[pos++];
+			if(trailingOperator())
+			{
+				pos = len;
+				break;
+			}
+
+			lhs = add(op, lhs, parseProduct());
+		}
+
+		return lhs;
+	}
+
+	constexpr int parseProduct()
+	{
+		int lhs = parsePower();
+
+		for(skipSpace(); pos < len && (s[pos] == '*' || s[pos] == '/' || s[pos] == '%'); skipSpace())
+		{
+			char op = s[pos++];
+			if(trailingOperator())
+			{
+				pos = len;
+				break;
+			}
+
+			lhs = add(op, lhs, parsePower());
+		}
+
+		return lhs;
+	}
+
+	// '^' is left associative in calc, so 2^3^2 is 64
+	constexpr int parsePower()
+	{
+		int lhs = parseUnary();
+
+		for(skipSpace(); pos < len && s[pos] == '^'; skipSpace())
+		{
+			pos++;
+			if(trailingOperator())
+			{
+				pos = len;
+				break;
+			}
+
+			lhs = add('^', lhs, parseUnary());
+		}
+
+		return lhs;
+	}
+
+	// Unary minus binds tighter than '^' (-2^2 is 4), but '!' goes first (-3! is -6)
+	constexpr int parseUnary()
+	{
+		skipSpace();
+
+		if(pos < len && s[pos] == '-')
+		{
+			pos++;
+			int a = parseUnary();
+			return add('n', a, a);
+		}
+
+		int a = parsePrimary();
+
+		for(skipSpace(); pos < len && s[pos] == '!'; skipSpace())
+		{
+			pos++;
+			a = add('!', a, a);
+		}
+
+		return a;
+	}
+
+	constexpr int parsePrimary()
+	{
+		skipSpace();
+
+		if(pos >= len)
+			throw "Invalid expression; No numerical tokens found while tokenizing the expression.";
+
+		if(s[pos] == '(')
+		{
+			pos++;
+			int a = parseSum();
+			skipSpace();
+
+			if(pos >= len || s[pos] != ')')
+				throw "Expression found without closing parenthesis";
+
+			pos++;
+			return a;
+		}
+
+		if(isDigit(s[pos]) || s[pos] == '.')
+			return add('c', 0, 0, parseNumber());
+
+		if(!isIdentStart(s[pos]))
+			throw "Invalid expression; No numerical tokens found while tokenizing the expression.";
+
+		std::size_t start = pos;
+		while(pos < len && isIdent(s[pos]))
+			pos++;
+
+		std::string_view name(s + start, pos - start);
+		skipSpace();
+
+		// A function will be followed by a parenthesis
+		if(pos < len && s[pos] == '(')
+		{
+			for(std::size_t f = 0; f < std::size(funcNames); f++)
+			{
+				if(funcNames[f] != name)
+					continue;
+
+				pos++;
+				int a = parseSum();
+				skipSpace();
+
+				if(pos >= len || s[pos] != ')')
+					throw "Function found without closing parenthesis";
+
+				pos++;
+				return add('f', a, a, 0.0, f);
+			}
+
+			throw "Unsupported function";
+		}
+
+		for(std::size_t c = 0; c < std::size(constNames); c++)
+		{
+			if(constNames[c] == name)
+				return add('c', 0, 0, constValues[c]);
+		}
+
+		for(int v = 0; v < tree.varCount; v++)
+		{
+			if(std::string_view(s + tree.varPos[v], tree.varLen[v]) == name)
+				return add('v', 0, 0, 0.0, v);
+		}
+
+		tree.varPos[tree.varCount] = start;
+		tree.varLen[tree.varCount] = name.size();
+		return add('v', 0, 0, 0.0, tree.varCount++);
+	}
+
+	// The same number syntax as calc's tokenizer. A leading zero means octal.
+	constexpr double parseNumber()
+	{
+		std::size_t start = pos;
+
+		if(s[pos] == '0' && pos + 2 < len && (s[pos + 1] | 0x20) == 'x' && isHex(s[pos + 2]))
+		{
+			double r = 0.0;
+			for(pos += 2; pos < len && isHex(s[pos]); pos++)
+				r = r * 16 + digitValue(s[pos]);
+
+			return r;
+		}
+
+		while(pos < len && isDigit(s[pos]))
+			pos++;
+
+		bool fraction = false;
+
+		// '1.' is a number, '.' on its own isn't
+		if(pos < len && s[pos] == '.')
+		{
+			fraction = true;
+			for(pos++; pos < len && isDigit(s[pos]); pos++)
+				;
+
+			if(pos == start + 1)
+				throw "Invalid expression; No numerical tokens found while tokenizing the expression.";
+		}
+
+		// An exponent only counts if it has digits
+		std::size_t mantissaEnd = pos;
+		if(pos < len && (s[pos] | 0x20) == 'e')
+		{
+			std::size_t e = pos + 1;
+			if(e < len && (s[e] == '+' || s[e] == '-'))
+				e++;
+
+			if(e < len && isDigit(s[e]))
+			{
+				fraction = true;
+				for(pos = e; pos < len && isDigit(s[pos]); pos++)
+					;
+			}
+		}
+
+		if(!fraction && s[start] == '0' && mantissaEnd - start > 1)
+		{
+			double r = 0.0;
+			for(std::size_t i = start + 1; i < mantissaEnd; i++)
+			{
+				if(s[i] > '7')
+					throw "Invalid digit in octal constant";
+
+				r = r * 8 + digitValue(s[i]);
+			}
+
+			return r;
+		}
+
+		return decimal(start, mantissaEnd, pos);
+	}
+
+	// Converts the decimal number in [start, end). Up to 19 significant digits and
+	// 10^22 either way, it's exact, like strtod().
+	constexpr double decimal(std::size_t start, std::size_t mantissaEnd, std::size_t end) const
+	{
+		std::uint64_t m = 0;
+		int digits = 0;
+		int exp10 = 0;
+		bool point = false;
+
+		for(std::size_t i = start; i < mantissaEnd; i++)
+		{
+			if(s[i] == '.')
+			{
+				point = true;
+				continue;
+			}
+
+			if(m == 0 && s[i] == '0')
+			{
+				if(point)
+					exp10--;
+
+				continue;
+			}
+
+			if(digits < 19)
+			{
+				m = m * 10 + digitValue(s[i]);
+				digits++;
+
+				if(point)
+					exp10--;
+			}
+			else if(!point)
+				exp10++;
+		}
+
+		if(mantissaEnd < end)
+		{
+			std::size_t i = mantissaEnd + 1;
+			bool neg = (s[i] == '-');
+
+			if(s[i] == '+' || s[i] == '-')
+				i++;
+
+			int e = 0;
+			for(; i < end && e < 100000; i++)
+				e = e * 10 + digitValue(s[i]);
+
+			exp10 += neg ? -e : e;
+		}
+
+		if(m == 0)
+			return 0.0;
+
+		if(m < (1ull << 53) && exp10 >= -22 && exp10 <= 22)
+			return (exp10 < 0) ? m / pow10(-exp10) : m * pow10(exp10);
+
+		long double r = m;
+		for(; exp10 > 0; exp10--)
+			r *= 10.0L;
+		for(; exp10 < 0; exp10++)
+			r /= 10.0L;
+
+		return r;
+	}
+};
+
+template<std::size_t N>
+constexpr exprTree<N> parse(const fixedString<N> &str)
+{
+	parser<N> p{str.text, str.size(), 0, {}};
+
+	if(p.len == 0)
+		throw "Empty expression";
+
+	p.tree.root = p.parseSum();
+	p.skipSpace();
+
+	if(p.pos < p.len && p.s[p.pos] == ')')
+		throw "Found a closing parenthesis without a matching '('";
+
+	if(p.pos < p.len)
+		throw "Number or name followed by a character that isn't an operator";
+
+	return p.tree;
+}
+
+} // namespace detail
+
+// ---- Expression templates ----
+//
+// Each node of the parsed expression becomes a type with an eval() that works out
+// its value from the variables. Everything is known at compile time, so the calls
+// all inline into straight-line code.
+
+template<double V>
+struct num
+{
+	static constexpr double eval(const double *) { return V; }
+};
+
+template<int I>
+struct var
+{
+	static constexpr double eval(const double *vars) { return vars[I]; }
+};
+
+template<char Op, class A, class B>
+struct binary
+{
+	static constexpr double eval(const double *vars)
+	{
+		const double a = A::eval(vars);
+		const double b = B::eval(vars);
+
+		if constexpr(Op == '+') return a + b;
+		else if constexpr(Op == '-') return a - b;
+		else if constexpr(Op == '*') return a * b;
+		else if constexpr(Op == '/') return a / b;
+		else if constexpr(Op == '%') return ::fmod(a, b);
+		else return ::pow(a, b);
+	}
+};
+
+template<class A>
+struct negate
+{
+	static constexpr double eval(const double *vars) { return -A::eval(vars); }
+};
+
+template<class A>
+struct factorial
+{
+	static constexpr double eval(const double *vars) { return ::tgamma(A::eval(vars) + 1.0); }
+};
+
+template<int F, class A>
+struct call
+{
+	static constexpr double eval(const double *vars) { return std::get<F>(funcs)(A::eval(vars)); }
+};
+
+namespace detail
+{
+
+template<auto T, int I, char Op = T.nodes[I].op>
+struct build
+{
+	using type = binary<Op, typename build<T, T.nodes[I].a>::type, typename build<T, T.nodes[I].b>::type>;
+};
+
+template<auto T, int I>
+struct build<T, I, 'c'>
+{
+	using type = num<T.nodes[I].value>;
+};
+
+template<auto T, int I>
+struct build<T, I, 'v'>
+{
+	using type = var<T.nodes[I].index>;
+};
+
+template<auto T, int I>
+struct build<T, I, 'n'>
+{
+	using type = negate<typename build<T, T.nodes[I].a>::type>;
+};
+
+template<auto T, int I>
+struct build<T, I, '!'>
+{
+	using type = factorial<typename build<T, T.nodes[I].a>::type>;
+};
+
+template<auto T, int I>
+struct build<T, I, 'f'>
+{
+	using type = call<T.nodes[I].index, typename build<T, T.nodes[I].a>::type>;
+};
+
+} // namespace detail
+
+// The expression 'S', parsed. Call it with a value for each variable.
+template<fixedString S>
+struct expr
+{
+	static constexpr exprTree<sizeof(S.text)> tree = detail::parse(S);
+	using type = typename detail::build<tree, tree.root>::type;
+
+	static constexpr int varCount = tree.varCount;
+
+	static constexpr std::string_view varName(int var)
+	{
+		return std::string_view(S.text + tree.varPos[var], tree.varLen[var]);
+	}
+
+	template<class... Args>
+	constexpr double operator()(Args... args) const
+	{
+		static_assert(sizeof...(Args) == varCount, "Pass one value for each variable in the expression");
+
+		const double vars[] = {static_cast<double>(args)..., 0.0};
+		return type::eval(vars);
+	}
+};
+
+} // namespace calc
+
+#endif
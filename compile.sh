@@ -1,11 +1,456 @@
 #!/bin/sh
 
-echo "Compiling calc.c..."
+# ./compile.sh           Builds ./calc for debugging (-O0 -g3), same as './compile.sh debug'
+# ./compile.sh release   Builds an optimized ./calc
+# ./compile.sh sanitize  Builds ./calc with AddressSanitizer and UndefinedBehaviorSanitizer
+# ./compile.sh pgo       Builds an optimized ./calc, trained on expressions from --gen
+# ./compile.sh startup   Builds a static ./calc that starts as quickly as possible
+# ./compile.sh bench     Builds each of the above and times them on the same expressions
+# ./compile.sh startbench  Times how long 'calc 1+2*3' takes from fork to exit
+# ./compile.sh lib       Builds libcalc.a and libcalc.so, to be used with calc.h
+# ./compile.sh polybench  Times libcalc on some polynomials, with and without fast math
+# ./compile.sh test      Checks the debug and release builds against known results, and
+#                        libcalc's fast math against the longhand results
+#
+# For release, pgo and bench, LTO=1 adds link-time optimization and MARCH=native (or
+# any other -march value) builds for one kind of CPU, e.g. 'MARCH=native ./compile.sh pgo'.
+# Optimized builds use -ffp-contract=off, so they get exactly the same results as the
+# debug build, even on CPUs with FMA. CC picks the compiler, e.g. CC=musl-gcc for a
+# smaller libc in the startup build.
 
-# Uncomment the below line to compile with tcc instead of gcc
-# tcc -lm -On -o ./calc ./calc.c
+# calc.hpp gets the constants and functions from calc.c through calc_tables.h, so
+# the two can't disagree. It's made fresh on every run.
+{
+	echo "// Generated from calc.c by compile.sh. Edit the lists there instead."
+	echo
+	sed -n '/^#define CALC_CONSTANTS/,/^$/p; /^#define CALC_FUNCTIONS/,/^$/p' ./calc.c
+} > ./calc_tables.h
 
-# Compile with GCC
-tail -n +3 ./calc.c | gcc -O0 -g3 -x c -o ./calc - -lm
+if [ "$1" = "lib" ]; then
+	echo "Compiling libcalc..."
+
+	# Only the functions in calc.h stay global, so the rest of calc.c can't clash
+	# with anything in the program the library gets linked into
+	KEEP=""
+	for SYM in calcCompile calcErrorCode calcErrorPos calcErrorMessage calcVarCount calcVarName \
+			   calcBind calcEval calcEvalBatch calcFastMath calcEvalGrad calcEvalGradBatch calcFree \
+			   calcCompileComplex calcBindComplex calcEvalComplex calcEvalComplexBatch; do
+		KEEP="$KEEP --keep-global-symbol=$SYM"
+	done
+
+	tail -n +3 ./calc.c | gcc -O2 -g -fPIC -DCALC_LIBRARY -x c -c -o ./libcalc.o - &&
+	objcopy $KEEP ./libcalc.o &&
+	rm -f ./libcalc.a && ar rcs ./libcalc.a ./libcalc.o &&
+	gcc -shared -o ./libcalc.so ./libcalc.o -lm
+
+	STATUS=$?
+	rm -f ./libcalc.o
+
+	if [ $STATUS -eq 0 ]; then echo "Finished compiling. Saved ./libcalc.a and ./libcalc.so"; fi
+	exit $STATUS
+fi
+
+MODE=${1:-debug}
+
+OPT="-O2 -g -ffp-contract=off"
+if [ "$LTO" = "1" ]; then OPT="$OPT -flto=auto"; fi
+if [ -n "$MARCH" ]; then OPT="$OPT -march=$MARCH"; fi
+
+CC=${CC:-gcc}
+
+# When calc is run once per expression, most of the time goes to the dynamic loader.
+# A static binary has nothing to load or bind, and leaving out unused code means
+# fewer pages to map.
+STARTUP="$OPT -static -Wl,-z,now -ffunction-sections -fdata-sections -Wl,--gc-sections -s"
+
+# How many expressions the PGO build is trained on and the benchmark evaluates, and
+# how many times startbench runs calc
+PGO_EXPRS=${PGO_EXPRS:-100000}
+BENCH_EXPRS=${BENCH_EXPRS:-200000}
+STARTUP_RUNS=${STARTUP_RUNS:-2000}
+
+# Everything gets built in here. The profile files are named after the source and
+# output files, so the PGO builds need them in a fixed place. The #line keeps error
+# messages and debug info pointing at calc.c.
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+{ echo "#line 3 \"$(pwd)/calc.c\""; tail -n +3 ./calc.c; } > "$WORK/calc.c"
+
+# build OUTPUT FLAGS...
+build()
+{
+	OUT=$1
+	shift
+	$CC "$@" -o "$OUT" "$WORK/calc.c" -lm
+}
+
+# buildPgo OUTPUT FLAGS...: an instrumented build runs over some generated expressions
+# in batch mode, then the real build uses the profile that left behind
+buildPgo()
+{
+	PGO_OUT=$1
+	shift
+	
+	rm -rf "$WORK/profile"
+	build "$WORK/train" "$@" -fprofile-generate="$WORK/profile" || return 1
+	
+	# Generating the expressions writes a profile too, which isn't wanted
+	"$WORK/train" --gen "$PGO_EXPRS" > "$WORK/train.txt" && rm -rf "$WORK/profile" || return 1
+	"$WORK/train" -b < "$WORK/train.txt" > /dev/null
+	"$WORK/train" -b --format sci < "$WORK/train.txt" > /dev/null
+	
+	build "$WORK/train" "$@" -fprofile-use="$WORK/profile" -fprofile-partial-training -Wno-missing-profile &&
+	mv "$WORK/train" "$PGO_OUT"
+}
+
+# Nanoseconds since the epoch
+now()
+{
+	date +%s%N
+}
+
+# timeRun BINARY: the best of three runs over the benchmark expressions, in ms
+timeRun()
+{
+	BEST=""
+	for RUN in 1 2 3; do
+		START=$(now)
+		"$1" -b < "$WORK/bench.txt" > "$WORK/out.txt"
+		TIME=$(( ($(now) - START) / 1000000 ))
+		
+		if [ -z "$BEST" ] || [ $TIME -lt $BEST ]; then BEST=$TIME; fi
+	done
+	
+	echo $BEST
+}
+
+# timeStartup COMMAND...: microseconds per run of COMMAND, which includes the fork
+# and exec it takes to start it
+timeStartup()
+{
+	START=$(now)
+	RUN=0
+	while [ $RUN -lt $STARTUP_RUNS ]; do
+		"$@" > /dev/null
+		RUN=$((RUN + 1))
+	done
+	
+	echo $(( ($(now) - START) / STARTUP_RUNS / 1000 ))
+}
+
+case "$MODE" in
+	debug)
+		echo "Compiling calc.c..."
+		
+		# Uncomment the below line to compile with tcc instead of gcc
+		# tcc -lm -On -o ./calc ./calc.c
+		
+		# Compile with GCC. Add -DCALC_NO_TRACE to leave out the --trace/-d code.
+		build ./calc -O0 -g3
+		;;
+		
+	release)
+		echo "Compiling calc.c ($OPT)..."
+		build ./calc $OPT
+		;;
+		
+	sanitize)
+		echo "Compiling calc.c with sanitizers..."
+		build ./calc -O1 -g -fno-omit-frame-pointer -fsanitize=address,undefined
+		;;
+		
+	pgo)
+		echo "Compiling calc.c ($OPT) and training it on $PGO_EXPRS expressions..."
+		buildPgo ./calc $OPT
+		;;
+		
+	startup)
+		echo "Compiling calc.c ($STARTUP)..."
+		build ./calc $STARTUP
+		;;
+		
+	startbench)
+		echo "Building..."
+		build "$WORK/debug" -O0 -g3 &&
+		build "$WORK/release" $OPT &&
+		build "$WORK/startup" $STARTUP || exit 1
+		
+		echo "Running 'calc 1+2*3' $STARTUP_RUNS times (the target is under 300 us):"
+		echo
+		
+		# /bin/true shows how much of that is the system's fork and exec alone
+		printf "\t%-10s %6d us\n" "/bin/true" "$(timeStartup /bin/true)"
+		
+		for NAME in debug release startup; do
+			printf "\t%-10s %6d us\n" "$NAME" "$(timeStartup "$WORK/$NAME" '1+2*3')"
+		done
+		
+		exit 0
+		;;
+		
+	polybench)
+		echo "Building..."
+		
+		# calcEval() a row at a time, then calcEvalBatch() on all of them, before and
+		# after calcFastMath() turns the polynomials into 'p' operations
+		cat > "$WORK/polybench.c" << 'EOF'
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "calc.h"
+
+#define ROWS 4096
+
+double x[ROWS], out[ROWS];
+
+// Nanoseconds per row, the best of 5 runs
+double timeRows(struct calcExpr *e, int batch)
+{
+	double best = 1e30;
+	
+	for(int run = 0; run < 5; run++)
+	{
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		
+		for(int i = 0; i < ROWS && !batch; i++)
+		{
+			calcBind(e, "x", x[i]);
+			calcEval(e, &out[i]);
+		}
+		
+		if(batch)
+			calcEvalBatch(e, x, ROWS, out);
+			
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / ROWS;
+		best = (ns < best) ? ns : best;
+	}
+	
+	return best;
+}
+
+int main(int argc, char **argv)
+{
+	for(int i = 0; i < ROWS; i++)
+		x[i] = rand() / (double) RAND_MAX * 4.0 - 2.0;
+		
+	for(int i = 1; i < argc; i++)
+	{
+		struct calcExpr *e = calcCompile(argv[i]);
+		double before = timeRows(e, 0);
+		double beforeBatch = timeRows(e, 1);
+		calcFastMath(e, 1);
+		
+		printf("%s\n\tcalcEval       %7.1f -> %6.1f ns\n", argv[i], before, timeRows(e, 0));
+		printf("\tcalcEvalBatch  %7.1f -> %6.1f ns\n", beforeBatch, timeRows(e, 1));
+		calcFree(e);
+	}
+	
+	return 0;
+}
+EOF
+		$CC $OPT -DCALC_LIBRARY -c -o "$WORK/calc.o" "$WORK/calc.c" &&
+		$CC $OPT -I. -o "$WORK/polybench" "$WORK/polybench.c" "$WORK/calc.o" -lm || exit 1
+		
+		echo "Nanoseconds per row, without fast math -> with it:"
+		echo
+		"$WORK/polybench" "3*x^4 + 2*x^3 - x + 7" "x^5 - 5*x^3 + 4*x" \
+			"1 + 2*x + 3*x^2 + 4*x^3 + 5*x^4 + 6*x^5 + 7*x^6 + 8*x^7 + 9*x^8" \
+			"x^16 - 8*x^14 + 20*x^12 - 16*x^10 + 2*x^8 + 3*x^5 - x^3 + x - 1"
+		exit 0
+		;;
+		
+	test)
+		echo "Building..."
+		build "$WORK/debug" -O0 -g3 &&
+		build "$WORK/release" $OPT || exit 1
+		
+		# FLAGS|EXPRESSION|EXPECTED, one per line. Each expression goes through
+		# 'calc -b FLAGS', so results are on one line and errors say where they are.
+		# The big numbers were checked against Python's integers and decimals.
+		cat > "$WORK/cases.txt" << 'EOF'
+|1+2*3|7
+|9223372036854775807+0|9223372036854775807
+|-9223372036854775808|-9223372036854775808
+|-9223372036854775809|-9223372036854776000
+|-(9223372036854775807+2)|-9223372036854776000
+|7/2|3.5
+|-7%3|-1
+|0x10+010|24
+|((((((((1))))))))*3!|6
+|sin(0)+cos(0)|1
+|(1+2|Expression found without closing parenthesis (column 1)
+|1+2)|Found a closing parenthesis without a matching '(' (column 4)
+--format raw|0.1+0.2|0.30000000000000004
+--format raw|1/3|0.3333333333333333
+--format raw|2^-1074|5e-324
+--format raw|5e-324*3|1.5e-323
+--format raw|1e23|1e+23
+--bigint|100!|93326215443944152681699238856266700490715968264381621468592963895217599993229915608941463976156518286253697920827223758251185210916864000000000000000000000000
+--bigint|(3^200)%(7^50)|1043054234746676783066714664998769142256021
+--bigint|2^200/3^50|2238393297946874000179418290327143433
+--bigint|(3^5000 * 7^4000) % 10^30|648367390017845080723398500001
+--bigint|(3^5000 / 7^1000) % 10^30|945191845554196496307352737013
+--bigint|(3^5000 % 7^1000) % 10^30|270090039542278015182075562988
+--prec 30|1/7|0.142857142857142857142857142857
+--prec 20|2-1/3|1.66666666666666666667
+--interval|0.1+0.2|[0.29999999999999993, 0.3000000000000001]
+--interval|sqrt(2)|[1.414213562373095, 1.4142135623730951]
+--complex|sqrt(-4)|2i
+--complex|(1+2*i)*(3-i)|5 + 5i
+--complex|(-8)^(1/3)|1.0000000000000002 + 1.7320508075688772i
+|[1,2;3,4]@[5;6]|[17; 39]
+|inv([2,0;0,4])|[0.5, 0; 0, 0.25]
+|transpose([1,2,3])|[1; 2; 3]
+|dot([1,2,3],[4,5,6])|32
+|[1,2]+[1,2,3]|Matrix sizes don't fit together for '+' (column 6)
+EOF
+		
+		FAILED=0
+		for NAME in debug release; do
+			while IFS='|' read -r FLAGS EXPR WANT; do
+				GOT=$(printf '%s\n' "$EXPR" | "$WORK/$NAME" -b $FLAGS 2>&1)
+				
+				if [ "$GOT" != "$WANT" ]; then
+					printf "\t%s: calc -b %s '%s'\n\t\texpected %s\n\t\tgot      %s\n" "$NAME" "$FLAGS" "$EXPR" "$WANT" "$GOT"
+					FAILED=$((FAILED + 1))
+				fi
+			done < "$WORK/cases.txt"
+		done
+		
+		CASES=$(wc -l < "$WORK/cases.txt")
+		if [ $FAILED -ne 0 ]; then
+			echo "$FAILED of $((CASES * 2)) checks failed."
+			exit 1
+		fi
+		
+		echo "All $CASES cases gave the expected results with the debug and release builds."
+		
+		# calcFastMath() works polynomials out with Horner's or Estrin's scheme, so the
+		# results only have to come close to the longhand ones. calcEvalBatch() has to
+		# give exactly what calcEval() does a row at a time, and there are enough rows
+		# that the last batch isn't full.
+		cat > "$WORK/polytest.c" << 'EOF'
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "calc.h"
+
+#define ROWS 203
+
+double x[ROWS], vars[ROWS * 2], exact[ROWS], fast[ROWS];
+
+int main(int argc, char **argv)
+{
+	double special[] = {0, 1, -1, 2, -3, 0.5, -2.75, 0.1, 1e3, 123456, 3e9, -7e18, 1e300, NAN};
+	int specials = sizeof(special) / sizeof(*special), failed = 0;
+	
+	for(int i = 0; i < ROWS; i++)
+		x[i] = (i < specials) ? special[i] : rand() / (double) RAND_MAX * 6.0 - 3.0;
+		
+	for(int i = 1; i < argc; i++)
+	{
+		struct calcExpr *e = calcCompile(argv[i]);
+		if(calcErrorCode(e))
+		{
+			printf("\t%s: %s\n", argv[i], calcErrorMessage(e));
+			failed++;
+			continue;
+		}
+		
+		// x goes through the values above, and any other variable is 2.5
+		int count = calcVarCount(e);
+		for(int row = 0; row < ROWS; row++)
+			for(int v = 0; v < count; v++)
+				vars[row * count + v] = strcmp(calcVarName(e, v), "x") ? 2.5 : x[row];
+				
+		calcEvalBatch(e, vars, ROWS, exact);
+		calcFastMath(e, 1);
+		calcEvalBatch(e, vars, ROWS, fast);
+		
+		for(int row = 0; row < ROWS; row++)
+		{
+			double one;
+			for(int v = 0; v < count; v++)
+				calcBind(e, calcVarName(e, v), vars[row * count + v]);
+				
+			calcEval(e, &one);
+			
+			// Where the longhand result is infinite it may have been inf - inf, which
+			// the fast one needn't repeat. NaN in still has to give NaN out.
+			int close = isfinite(exact[row]) ? fabs(fast[row] - exact[row]) <= 1e-12 * fmax(fabs(exact[row]), 1) : !isnan(x[row]) || isnan(fast[row]);
+			int same = !memcmp(&one, &fast[row], sizeof(one)) || (isnan(one) && isnan(fast[row]));
+			
+			if(!close || !same)
+			{
+				printf("\t%s at x = %.17g: longhand %.17g, fast %.17g, one row at a time %.17g\n", argv[i], x[row], exact[row], fast[row], one);
+				failed++;
+			}
+		}
+		
+		calcFree(e);
+	}
+	
+	if(failed)
+		printf("%d polynomial checks failed.\n", failed);
+	else
+		printf("Fast math agreed with the longhand results for all %d polynomials.\n", argc - 1);
+		
+	return failed != 0;
+}
+EOF
+		$CC $OPT -DCALC_LIBRARY -c -o "$WORK/calc.o" "$WORK/calc.c" &&
+		$CC $OPT -I. -o "$WORK/polytest" "$WORK/polytest.c" "$WORK/calc.o" -lm || exit 1
+		
+		"$WORK/polytest" "3*x^4 + 2*x^3 - x + 7" "x^2" "-x^3 + 2*x - 5" "(x + 1)^2" "2*(x^2 + 3*x) - x/2" \
+			"1 + x + x^2 + x^3 + x^4 + x^5 + x^6 + x^7 + x^8" "0.1*x^9 - 0.3*x^5 + x^2/1" \
+			"x^16 - 3*x^15 + x^2*x^3 + 1.5*x^7 - 0.25" "x^17 + x" "(x^3)^5 + x" "5 - (x - 3)*x^2" \
+			"sin(x^2 + 1) + x^3*2 + y" "x^2 + y^2"
+		exit $?
+		;;
+		
+	bench)
+		echo "Building..."
+		build "$WORK/debug" -O0 -g3 &&
+		build "$WORK/release" $OPT &&
+		build "$WORK/lto" $OPT -flto=auto &&
+		build "$WORK/native" $OPT -march=native &&
+		buildPgo "$WORK/pgo" $OPT &&
+		buildPgo "$WORK/pgo-all" $OPT -flto=auto -march=native || exit 1
+		
+		"$WORK/release" --gen "$BENCH_EXPRS" > "$WORK/bench.txt"
+		
+		echo "Evaluating $BENCH_EXPRS expressions with 'calc -b' (best of 3):"
+		echo
+		
+		BASE=""
+		for NAME in debug release lto native pgo pgo-all; do
+			TIME=$(timeRun "$WORK/$NAME")
+			if [ -z "$BASE" ]; then
+				BASE=$TIME
+				cp "$WORK/out.txt" "$WORK/expected.txt"
+			fi
+			
+			SAME=""
+			if ! cmp -s "$WORK/out.txt" "$WORK/expected.txt"; then SAME="  (results differ from debug!)"; fi
+			
+			# Speedup with two decimals, in integer math
+			SPEEDUP=$(( BASE * 100 / (TIME > 0 ? TIME : 1) ))
+			printf "\t%-10s %6d ms  %3d.%02dx%s\n" "$NAME" "$TIME" $((SPEEDUP / 100)) $((SPEEDUP % 100)) "$SAME"
+		done
+		
+		echo
+		echo "release is $OPT; lto and native add -flto and -march=native to it."
+		echo "pgo is release trained on $PGO_EXPRS expressions, pgo-all is that plus both."
+		exit 0
+		;;
+		
+	*)
+		echo "Unknown build '$MODE'. Try debug, release, sanitize, pgo, startup, bench, startbench, polybench, test or lib."
+		exit 1
+		;;
+esac
 
 if [ $? -eq 0 ]; then echo "Finished compiling. Executable file saved to ./calc. Enjoy!"; fi